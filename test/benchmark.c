@@ -0,0 +1,258 @@
+/*
+ * Host benchmark for the per-sample kernels: software volume, requantization
+ * and the offline sign/endian conversion, for every format, mono and stereo,
+ * 256 to 8192 samples. Writes one CSV line per case and compares ns/sample
+ * with a baseline when one is given.
+ *
+ * Usage: benchmark <output.csv> [<baseline.csv> [<tolerance>]]
+ * Build & run: make -C test bench (bench-baseline to refresh the baseline)
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "usound.h"
+
+#define MIN_SAMPLES	256
+#define MAX_SAMPLES	8192
+#define MIN_TIME	10e6	/* ns per run */
+#define RUNS		3		/* best of */
+
+static const char* const formatNames[AudioFormatCount] = {
+	"s8", "s16lsb", "s16msb", "u8", "u16lsb", "u16msb"
+};
+
+static int16_t source[MAX_SAMPLES * 2];
+static uint8_t buffer[MAX_SAMPLES * 2 * 2];
+static uint8_t memory[44 + sizeof(buffer)];
+static uint32_t memoryLength;
+
+typedef struct {
+	const char* name;
+	int eightBitOnly;	/* AtariSoundSetupRequantize() produces 8-bit only */
+	void (*run)(const AudioSpec* spec, int iteration);
+} Kernel;
+
+static void RunApplyVolume(const AudioSpec* spec, int iteration) {
+	/* a new volume each buffer: always ramping, the worst case */
+	AtariSoundSetupSetVolume(iteration & 1 ? 128 : 200, 0);
+	AtariSoundSetupApplyVolume(buffer, spec);
+}
+
+static void RunRequantize(const AudioSpec* spec, int iteration) {
+	(void)iteration;
+	AtariSoundSetupRequantize(source, buffer, spec, 0);
+}
+
+static void RunRequantizeShaped(const AudioSpec* spec, int iteration) {
+	(void)iteration;
+	AtariSoundSetupRequantize(source, buffer, spec, 1);
+}
+
+static void RunRequantizeGain(const AudioSpec* spec, int iteration) {
+	AtariSoundSetupSetVolume(iteration & 1 ? 128 : 200, 0);
+	AtariSoundSetupRequantize(source, buffer, spec, 0);
+}
+
+static void RunRequantizeGainShaped(const AudioSpec* spec, int iteration) {
+	AtariSoundSetupSetVolume(iteration & 1 ? 128 : 200, 0);
+	AtariSoundSetupRequantize(source, buffer, spec, 1);
+}
+
+static void RunWriteOffline(const AudioSpec* spec, int iteration) {
+	(void)spec;
+	(void)iteration;
+	/* overwrite the same data chunk each time */
+	memoryLength = 44;
+	AtariSoundSetupWriteOffline(buffer);
+}
+
+static const Kernel kernels[] = {
+	{ "apply_volume",              0, RunApplyVolume },
+	{ "requantize",                1, RunRequantize },
+	{ "requantize_shaped",         1, RunRequantizeShaped },
+	{ "requantize_gain",           1, RunRequantizeGain },
+	{ "requantize_gain_shaped",    1, RunRequantizeGainShaped },
+	{ "write_offline",             0, RunWriteOffline }
+};
+
+typedef struct {
+	char key[64];
+	double nsPerSample;
+} Result;
+
+static Result baseline[512];
+static int baselineCount;
+
+static double Now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* best of RUNS, in ns per buffer */
+static double Measure(const Kernel* kernel, const AudioSpec* spec) {
+	double best = 0.0;
+	int run;
+
+	for (run = 0; run < RUNS; run++) {
+		double start = Now();
+		double elapsed;
+		long iterations = 0;
+
+		do {
+			kernel->run(spec, (int)iterations);
+			iterations++;
+			elapsed = Now() - start;
+		} while (elapsed < MIN_TIME);
+
+		if (run == 0 || elapsed / iterations < best)
+			best = elapsed / iterations;
+	}
+
+	return best;
+}
+
+static int LoadBaseline(const char* filename) {
+	FILE* f = fopen(filename, "r");
+	char line[256];
+
+	if (!f)
+		return 0;
+
+	while (fgets(line, sizeof(line), f) && baselineCount < (int)(sizeof(baseline) / sizeof(baseline[0]))) {
+		char kernel[32], format[16];
+		int channels, samples;
+		double nsPerSample;
+
+		if (sscanf(line, "%31[^,],%15[^,],%d,%d,%lf", kernel, format, &channels, &samples, &nsPerSample) != 5)
+			continue;	/* header */
+
+		snprintf(baseline[baselineCount].key, sizeof(baseline[0].key), "%s,%s,%d,%d", kernel, format, channels, samples);
+		baseline[baselineCount].nsPerSample = nsPerSample;
+		baselineCount++;
+	}
+
+	fclose(f);
+	return 1;
+}
+
+static const Result* FindBaseline(const char* key) {
+	int i;
+
+	for (i = 0; i < baselineCount; i++) {
+		if (strcmp(baseline[i].key, key) == 0)
+			return &baseline[i];
+	}
+
+	return NULL;
+}
+
+int main(int argc, char* argv[]) {
+	const double tolerance = argc > 3 ? atof(argv[3]) : 2.0;
+	FILE* out;
+	uint32_t seed = 1;
+	unsigned k;
+	int format, channels, samples;
+	int regressions = 0;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s <output.csv> [<baseline.csv> [<tolerance>]]\n", argv[0]);
+		return 2;
+	}
+
+	if (argc > 2 && !LoadBaseline(argv[2])) {
+		fprintf(stderr, "%s: can't read baseline %s\n", argv[0], argv[2]);
+		return 2;
+	}
+
+	out = fopen(argv[1], "w");
+	if (!out) {
+		fprintf(stderr, "%s: can't write %s\n", argv[0], argv[1]);
+		return 2;
+	}
+
+	for (samples = 0; samples < MAX_SAMPLES * 2; samples++) {
+		seed = seed * 1103515245 + 12345;
+		source[samples] = (int16_t)(seed >> 16);
+		buffer[samples * 2] = (uint8_t)(seed >> 8);
+		buffer[samples * 2 + 1] = (uint8_t)(seed >> 24);
+	}
+
+	/* what the Init functions do */
+	RequantizeBuildNoise();
+
+	fprintf(out, "kernel,format,channels,samples,ns_per_sample,bytes_per_s\n");
+	printf("%-24s %-7s %2s %5s %10s %14s %8s\n", "kernel", "format", "ch", "n", "ns/sample", "bytes/s", "vs base");
+
+	for (k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+		const Kernel* kernel = &kernels[k];
+
+		for (format = 0; format < AudioFormatCount; format++) {
+			const int bytes = (format == AudioFormatSigned8 || format == AudioFormatUnsigned8) ? 1 : 2;
+
+			if (kernel->eightBitOnly && bytes != 1)
+				continue;
+
+			for (channels = 1; channels <= 2; channels++) {
+				for (samples = MIN_SAMPLES; samples <= MAX_SAMPLES; samples *= 2) {
+					AudioSpec spec;
+					const Result* base;
+					char key[64];
+					double nsPerBuffer, nsPerSample, bytesPerSecond;
+
+					spec.frequency = 50066;
+					spec.channels = (uint8_t)channels;
+					spec.format = (AudioFormat)format;
+					spec.samples = (uint16_t)samples;
+					spec.size = (uint32_t)samples * channels * bytes;
+
+					AtariSoundSetupSetVolume(256, 0);
+					if (kernel->run == RunWriteOffline) {
+						AudioSpec desired = { 50066, 1, AudioFormatSigned8, 256, 0 };
+						AudioSpec obtained;
+
+						AtariSoundSetupInitOfflineMemory(&desired, &obtained, AudioMachineFalcon, memory, sizeof(memory), &memoryLength);
+						/* the conversion only depends on the format, not on what a machine could negotiate */
+						offlineSpec = spec;
+					}
+
+					nsPerBuffer = Measure(kernel, &spec);
+
+					if (kernel->run == RunWriteOffline)
+						AtariSoundSetupDeinitOffline();
+
+					/* a frame (all channels) counts as one sample, like AudioSpec.samples */
+					nsPerSample = nsPerBuffer / samples;
+					bytesPerSecond = spec.size * 1e9 / nsPerBuffer;
+
+					snprintf(key, sizeof(key), "%s,%s,%d,%d", kernel->name, formatNames[format], channels, samples);
+					fprintf(out, "%s,%.3f,%.0f\n", key, nsPerSample, bytesPerSecond);
+
+					printf("%-24s %-7s %2d %5d %10.3f %14.0f", kernel->name, formatNames[format], channels, samples, nsPerSample, bytesPerSecond);
+					base = FindBaseline(key);
+					if (base) {
+						double ratio = nsPerSample / base->nsPerSample;
+
+						printf(" %7.2fx%s", ratio, ratio > tolerance ? " REGRESSION" : "");
+						if (ratio > tolerance)
+							regressions++;
+					} else if (baselineCount > 0) {
+						printf("     new");
+					}
+					printf("\n");
+				}
+			}
+		}
+	}
+
+	fclose(out);
+
+	if (regressions) {
+		printf("%d case(s) more than %.1fx slower than the baseline\n", regressions, tolerance);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,26 @@
+/*
+ * Host stand-in for MiNTLib's <mint/cookie.h>, just enough to compile
+ * usound.h for the tests. There is no cookie jar on the host.
+ */
+
+#ifndef _MINT_COOKIE_H
+#define _MINT_COOKIE_H
+
+#define C__MCH		0x5F4D4348L	/* "_MCH" */
+#define C__SND		0x5F534E44L	/* "_SND" */
+#define C_McSn		0x4D63536EL	/* "McSn" */
+#define C_STFA		0x53544641L	/* "STFA" */
+
+#define C_FOUND		0
+#define C_NOTFOUND	(-1)
+
+#define SND_PSG		0x01
+#define SND_8BIT	0x02
+#define SND_16BIT	0x04
+#define SND_DSP		0x08
+#define SND_MATRIX	0x10
+#define SND_EXT		0x20
+
+static inline long Getcookie(long cookie, long* value) { (void)cookie; (void)value; return C_NOTFOUND; }
+
+#endif
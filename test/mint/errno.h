@@ -0,0 +1,11 @@
+/*
+ * Host stand-in for MiNTLib's <mint/errno.h>, just enough to compile
+ * usound.h for the tests.
+ */
+
+#ifndef _MINT_ERRNO_H
+#define _MINT_ERRNO_H
+
+#define ENOSYS	32
+
+#endif
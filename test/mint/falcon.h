@@ -0,0 +1,68 @@
+/*
+ * Host stand-in for MiNTLib's <mint/falcon.h>, just enough to compile
+ * usound.h for the tests. All sound XBIOS calls fail.
+ */
+
+#ifndef _MINT_FALCON_H
+#define _MINT_FALCON_H
+
+#define LTATTEN			0
+#define RTATTEN			1
+#define LTGAIN			2
+#define RTGAIN			3
+#define ADDERIN			4
+#define ADCINPUT		5
+#define SETPRESCALE		6
+#define SND_INQUIRE		(-1)
+
+#define MATIN			2
+
+#define PRE1280			0
+#define PRE640			1
+#define PRE320			2
+#define PRE160			3
+
+#define MODE_STEREO8	0
+#define MODE_STEREO16	1
+#define MODE_MONO		2
+
+#define SB_PLA_ENA		0x01
+#define SB_PLA_RPT		0x02
+
+#define SR_PLAY			0
+
+#define DMAPLAY			0
+#define DAC				0x08
+
+#define CLK25M			0
+#define CLKEXT			1
+
+#define CLKOLD			0
+#define CLK50K			1
+#define CLK33K			2
+#define CLK25K			3
+#define CLK20K			4
+#define CLK16K			5
+#define CLK12K			7
+#define CLK10K			9
+#define CLK8K			11
+
+#define NO_SHAKE		1
+
+#define SND_RESET		1
+
+#define GPIO_SET		0
+#define GPIO_READ		1
+#define GPIO_WRITE		2
+
+static inline long Locksnd(void) { return -128L; }
+static inline long Unlocksnd(void) { return -128L; }
+static inline long Soundcmd(long mode, long data) { (void)mode; (void)data; return -1L; }
+static inline long Setbuffer(long reg, const void* begin, const void* end) { (void)reg; (void)begin; (void)end; return -1L; }
+static inline long Setmode(long mode) { (void)mode; return -1L; }
+static inline long Buffoper(long mode) { (void)mode; return -1L; }
+static inline long Devconnect(long src, long dst, long clk, long pre, long proto) { (void)src; (void)dst; (void)clk; (void)pre; (void)proto; return -1L; }
+static inline long Sndstatus(long reset) { (void)reset; return -1L; }
+static inline long Gpio(long mode, long data) { (void)mode; (void)data; return -1L; }
+
+#endif
@@ -0,0 +1,25 @@
+/*
+ * Host stand-in for MiNTLib's <mint/osbind.h>, just enough to compile
+ * usound.h for the tests. All GEMDOS/(X)BIOS calls fail.
+ */
+
+#ifndef _MINT_OSBIND_H
+#define _MINT_OSBIND_H
+
+#define MX_STRAM	0
+
+static inline void* Mxalloc(long size, long mode) { (void)size; (void)mode; return 0; }
+static inline void* Malloc(long size) { (void)size; return 0; }
+static inline long Mfree(void* ptr) { (void)ptr; return -1L; }
+static inline long Supexec(long (*func)(void)) { (void)func; return -1L; }
+static inline long Fcreate(const char* name, long attr) { (void)name; (void)attr; return -1L; }
+static inline long Fwrite(long handle, long count, const void* buf) { (void)handle; (void)count; (void)buf; return -1L; }
+static inline long Fseek(long offset, long handle, long mode) { (void)offset; (void)handle; (void)mode; return -1L; }
+static inline long Fclose(long handle) { (void)handle; return -1L; }
+static inline long Giaccess(long data, long reg) { (void)data; (void)reg; return 0; }
+static inline long Xbtimer(long timer, long ctrl, long data, void (*vec)(void)) { (void)timer; (void)ctrl; (void)data; (void)vec; return -1L; }
+static inline long Setexc(long vec, long addr) { (void)vec; (void)addr; return 0; }
+static inline long Jdisint(long vec) { (void)vec; return -1L; }
+static inline long Jenabint(long vec) { (void)vec; return -1L; }
+
+#endif
@@ -0,0 +1,135 @@
+/*
+ * Host test for the offline backend: checks the negotiated AudioSpec for
+ * every AudioMachine, the WAV header and the sign/endian conversion, using
+ * the memory sink.
+ *
+ * Build & run: make -C test
+ */
+
+#include <stdio.h>
+
+#include "usound.h"
+
+static int failures;
+
+static void Check(int ok, const char* what) {
+	printf("%-56s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok)
+		failures++;
+}
+
+static uint32_t GetLe32(const uint8_t* p) {
+	return p[0] | (p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t GetLe16(const uint8_t* p) {
+	return p[0] | (p[1] << 8);
+}
+
+static void CheckMachine(const char* name, AudioMachine machine, AudioSpec desired,
+                         uint16_t frequency, uint8_t channels, AudioFormat format, uint32_t size) {
+	static uint8_t memory[64];
+	AudioSpec obtained;
+	uint32_t length;
+	char what[80];
+	int ok;
+
+	ok = AtariSoundSetupInitOfflineMemory(&desired, &obtained, machine, memory, sizeof(memory), &length);
+	if (ok) {
+		printf("%-10s %5u Hz %u ch format %d -> %5u Hz %u ch format %d, %lu bytes\n", name,
+			desired.frequency, desired.channels, desired.format,
+			obtained.frequency, obtained.channels, obtained.format, (unsigned long)obtained.size);
+		ok = obtained.frequency == frequency && obtained.channels == channels
+			&& obtained.format == format && obtained.samples == desired.samples && obtained.size == size;
+		AtariSoundSetupDeinitOffline();
+	}
+
+	snprintf(what, sizeof(what), "%s: negotiated spec", name);
+	Check(ok, what);
+}
+
+static void CheckNegotiation(void) {
+	AudioSpec stereo16 = { 44100, 2, AudioFormatSigned16MSB, 1024, 0 };
+	AudioSpec mono16 = { 44100, 1, AudioFormatSigned16LSB, 1024, 0 };
+	AudioSpec stereo8 = { 6000, 2, AudioFormatUnsigned8, 512, 0 };
+
+	/* YM2149: 8-bit mono at 614400 / timer data Hz, sign taken from the request */
+	CheckMachine("ST", AudioMachineSt, stereo16, 9600, 1, AudioFormatSigned8, 1024);
+	CheckMachine("ST", AudioMachineSt, stereo8, 6023, 1, AudioFormatUnsigned8, 512);
+	/* DMA 8-bit only */
+	CheckMachine("STE", AudioMachineSte, stereo16, 50066, 2, AudioFormatSigned8, 2048);
+	CheckMachine("STE", AudioMachineSte, stereo8, 6258, 2, AudioFormatSigned8, 1024);
+	CheckMachine("TT", AudioMachineTt, stereo16, 50066, 2, AudioFormatSigned8, 2048);
+	/* CODEC: 16-bit is stereo only, no 6258 Hz */
+	CheckMachine("Falcon", AudioMachineFalcon, stereo16, 49170, 2, AudioFormatSigned16MSB, 4096);
+	CheckMachine("Falcon", AudioMachineFalcon, mono16, 49170, 2, AudioFormatSigned16MSB, 4096);
+	CheckMachine("Falcon", AudioMachineFalcon, stereo8, 8195, 2, AudioFormatSigned8, 1024);
+}
+
+static void CheckHeader(void) {
+	static uint8_t memory[44 + 3 * 4096];
+	static uint8_t buffer[4096];
+	AudioSpec desired = { 44100, 2, AudioFormatSigned16MSB, 1024, 0 };
+	AudioSpec obtained;
+	uint32_t length;
+	int ok;
+
+	ok = AtariSoundSetupInitOfflineMemory(&desired, &obtained, AudioMachineFalcon, memory, sizeof(memory), &length);
+	Check(ok && length == 44, "header written on init");
+
+	ok = ok && AtariSoundSetupWriteOffline(buffer) && AtariSoundSetupWriteOffline(buffer)
+		&& AtariSoundSetupWriteOffline(buffer);
+	Check(ok && length == sizeof(memory), "three buffers appended");
+	Check(!AtariSoundSetupWriteOffline(buffer), "overflow rejected");
+	Check(AtariSoundSetupDeinitOffline(), "deinit");
+
+	Check(memcmp(&memory[0], "RIFF", 4) == 0 && GetLe32(&memory[4]) == 36 + 3 * 4096
+		&& memcmp(&memory[8], "WAVEfmt ", 8) == 0 && GetLe32(&memory[16]) == 16,
+		"RIFF chunk");
+	Check(GetLe16(&memory[20]) == 1 && GetLe16(&memory[22]) == 2 && GetLe32(&memory[24]) == 49170
+		&& GetLe32(&memory[28]) == 49170 * 4 && GetLe16(&memory[32]) == 4 && GetLe16(&memory[34]) == 16,
+		"fmt chunk");
+	Check(memcmp(&memory[36], "data", 4) == 0 && GetLe32(&memory[40]) == 3 * 4096, "data chunk");
+}
+
+/* WAV wants unsigned 8-bit and signed 16-bit little endian */
+static void CheckConversion(const char* what, AudioFormat format, const uint8_t in[4], const uint8_t out[4]) {
+	static uint8_t memory[44 + 4];
+	uint8_t buffer[4];
+	uint32_t length;
+	int ok;
+
+	/* conversion is keyed on offlineSpec.format only; mono 8-bit gives a 4 byte buffer for any format */
+	AudioSpec desired = { 6000, 1, AudioFormatSigned8, 4, 0 };
+	AudioSpec obtained;
+
+	ok = AtariSoundSetupInitOfflineMemory(&desired, &obtained, AudioMachineSt, memory, sizeof(memory), &length);
+	if (ok) {
+		offlineSpec.format = format;
+		memcpy(buffer, in, sizeof(buffer));
+		ok = AtariSoundSetupWriteOffline(buffer) && AtariSoundSetupDeinitOffline()
+			&& memcmp(&memory[44], out, 4) == 0 && memcmp(buffer, in, sizeof(buffer)) == 0;
+	}
+
+	Check(ok, what);
+}
+
+int main(void) {
+	static const uint8_t samples[4] = { 0x00, 0x7f, 0x80, 0xff };
+	static const uint8_t toggled[4] = { 0x80, 0xff, 0x00, 0x7f };
+	static const uint8_t swapped[4] = { 0x7f, 0x00, 0xff, 0x80 };
+	static const uint8_t signedHigh[4] = { 0x00, 0xff, 0x80, 0x7f };
+	static const uint8_t swappedSignedHigh[4] = { 0x7f, 0x80, 0xff, 0x00 };
+
+	CheckNegotiation();
+	CheckHeader();
+
+	CheckConversion("Signed8 -> unsigned", AudioFormatSigned8, samples, toggled);
+	CheckConversion("Unsigned8 unchanged", AudioFormatUnsigned8, samples, samples);
+	CheckConversion("Signed16LSB unchanged", AudioFormatSigned16LSB, samples, samples);
+	CheckConversion("Signed16MSB -> byte swapped", AudioFormatSigned16MSB, samples, swapped);
+	CheckConversion("Unsigned16LSB -> signed", AudioFormatUnsigned16LSB, samples, signedHigh);
+	CheckConversion("Unsigned16MSB -> byte swapped, signed", AudioFormatUnsigned16MSB, samples, swappedSignedHigh);
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,85 @@
+/*
+ * Host test for the YM2149 volume table used by the timer A fallback.
+ *
+ * Build & run: make -C test
+ */
+
+#include <stdio.h>
+
+#include "usound.h"
+
+/* nominal DAC levels, same as in PsgBuildTable() */
+static const long levels[16] = {
+	0, 64, 91, 128, 181, 256, 362, 512, 724, 1024, 1448, 2048, 2896, 4096, 5793, 8192
+};
+
+static int CheckTable(int isSigned) {
+	const int flip = isSigned ? 0x80 : 0x00;
+	long previous = -1;
+	int distinct = 0;
+	int errors = 0;
+	int i;
+
+	memset(psgTable, 0xff, sizeof(psgTable));
+	PsgBuildTable(isSigned);
+
+	/* walk from the lowest to the highest sample value */
+	for (i = 0; i < 256; i++) {
+		const uint16_t* entry = psgTable[i ^ flip];
+		long sum;
+		int c;
+
+		for (c = 0; c < 3; c++) {
+			if ((entry[c] >> 8) != 0x08 + c || (entry[c] & 0xff) > 15) {
+				printf("%s: sample %d: invalid register write 0x%04x\n", isSigned ? "signed" : "unsigned", i, entry[c]);
+				errors++;
+			}
+		}
+		if (entry[3] != 0) {
+			printf("%s: sample %d: padding not zero\n", isSigned ? "signed" : "unsigned", i);
+			errors++;
+		}
+		if (errors)
+			break;
+
+		sum = levels[entry[0] & 15] + levels[entry[1] & 15] + levels[entry[2] & 15];
+		if (sum < previous) {
+			printf("%s: sample %d: level %ld lower than %ld\n", isSigned ? "signed" : "unsigned", i, sum, previous);
+			errors++;
+		}
+		if (sum != previous)
+			distinct++;
+		previous = sum;
+	}
+
+	if (!errors) {
+		const uint16_t* lowest = psgTable[0 ^ flip];
+		const uint16_t* highest = psgTable[255 ^ flip];
+
+		if ((lowest[0] & 15) || (lowest[1] & 15) || (lowest[2] & 15)) {
+			printf("%s: lowest sample isn't silence\n", isSigned ? "signed" : "unsigned");
+			errors++;
+		}
+		if ((highest[0] & 15) != 15 || (highest[1] & 15) != 15 || (highest[2] & 15) != 15) {
+			printf("%s: highest sample isn't full volume\n", isSigned ? "signed" : "unsigned");
+			errors++;
+		}
+		/* 3 channels give far more than 16 usable levels */
+		if (distinct < 128) {
+			printf("%s: only %d distinct levels\n", isSigned ? "signed" : "unsigned", distinct);
+			errors++;
+		}
+	}
+
+	printf("%s: %d distinct levels, %s\n", isSigned ? "signed" : "unsigned", distinct, errors ? "FAILED" : "ok");
+	return errors;
+}
+
+int main(void) {
+	int errors = 0;
+
+	errors += CheckTable(0);
+	errors += CheckTable(1);
+
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,141 @@
+/*
+ * Host test for the dithered 16 to 8-bit requantization: measures the
+ * noise floor of plain truncation, TPDF dither and noise shaped dither on a
+ * -21 dBFS sine.
+ *
+ * Build & run: make -C test
+ */
+
+#include <math.h>
+#include <stdio.h>
+
+#include "usound.h"
+
+#define SAMPLES	4096
+#define BUFFERS	32
+#define TAPS	16
+
+typedef struct {
+	double power;	/* mean squared error, in dB relative to full scale */
+	double inBand;	/* same after a 16-tap moving average (lowpass, ~3 kHz), in dB */
+	double mean;	/* mean error, in 16-bit LSBs */
+} Noise;
+
+/* 0: truncation, 1: TPDF dither, 2: TPDF dither + noise shaping */
+static Noise Measure(int mode) {
+	static int16_t src[SAMPLES];
+	static int8_t dst[SAMPLES];
+	AudioSpec spec = { 50066, 1, AudioFormatSigned8, SAMPLES, SAMPLES };
+	double phase = 0.0;
+	double sum = 0.0;
+	double sum2 = 0.0;
+	double sumInBand2 = 0.0;
+	double history[TAPS] = { 0.0 };
+	double window = 0.0;
+	long n = 0;
+	Noise noise;
+	int b, i;
+
+	for (b = 0; b < BUFFERS; b++) {
+		for (i = 0; i < SAMPLES; i++) {
+			src[i] = (int16_t)lrint(2900.0 * sin(phase));
+			phase += 2.0 * M_PI * 440.0 / 50066.0;
+		}
+
+		if (mode == 0) {
+			for (i = 0; i < SAMPLES; i++)
+				dst[i] = (int8_t)(src[i] >> 8);
+		} else {
+			AtariSoundSetupRequantize(src, dst, &spec, mode == 2);
+		}
+
+		for (i = 0; i < SAMPLES; i++) {
+			double e = dst[i] * 256.0 - src[i];
+			double lowpass;
+
+			window += e - history[n % TAPS];
+			history[n % TAPS] = e;
+			lowpass = window / TAPS;
+
+			sum += e;
+			sum2 += e * e;
+			if (n >= TAPS)
+				sumInBand2 += lowpass * lowpass;
+			n++;
+		}
+	}
+
+	noise.power = 10.0 * log10(sum2 / n / (32768.0 * 32768.0));
+	noise.inBand = 10.0 * log10(sumInBand2 / (n - TAPS) / (32768.0 * 32768.0));
+	noise.mean = sum / n;
+	return noise;
+}
+
+/* stereo unsigned output at volume 128 must be half of the input, both channels */
+static int CheckVolume(void) {
+	static int16_t src[2 * SAMPLES];
+	static uint8_t dst[2 * SAMPLES];
+	AudioSpec spec = { 50066, 2, AudioFormatUnsigned8, SAMPLES, 2 * SAMPLES };
+	double sum2[2] = { 0.0, 0.0 };
+	int i, pass;
+
+	for (i = 0; i < SAMPLES; i++)
+		src[2 * i] = src[2 * i + 1] = (int16_t)lrint(16000.0 * sin(2.0 * M_PI * i / 64.0));
+
+	AtariSoundSetupSetVolume(128, 0);
+
+	/* the first pass ramps, the second one is at the target volume */
+	for (pass = 0; pass < 2; pass++)
+		AtariSoundSetupRequantize(src, dst, &spec, pass);
+
+	for (i = 0; i < 2 * SAMPLES; i++) {
+		double e = (dst[i] - 128) * 256.0 - src[i] / 2.0;
+
+		sum2[i & 1] += e * e;
+	}
+
+	AtariSoundSetupSetVolume(256, 0);
+
+	/* i.e. only the requantization noise is left */
+	return sqrt(sum2[0] / SAMPLES) < 256.0 && sqrt(sum2[1] / SAMPLES) < 256.0;
+}
+
+static int Check(int condition, const char* what) {
+	printf("%-60s %s\n", what, condition ? "ok" : "FAILED");
+	return condition ? 0 : 1;
+}
+
+int main(void) {
+	static const int16_t extremes[4] = { 32767, -32768, 32767, -32768 };
+	int8_t clipped[4];
+	AudioSpec spec = { 50066, 2, AudioFormatSigned8, 2, 4 };
+	Noise truncated;
+	Noise dithered;
+	Noise shaped;
+	int errors = 0;
+
+	/* what the Init functions do */
+	RequantizeBuildNoise();
+
+	truncated = Measure(0);
+	dithered = Measure(1);
+	shaped = Measure(2);
+
+	printf("truncation: %6.1f dB, in band %6.1f dB, mean %+7.2f\n", truncated.power, truncated.inBand, truncated.mean);
+	printf("TPDF:       %6.1f dB, in band %6.1f dB, mean %+7.2f\n", dithered.power, dithered.inBand, dithered.mean);
+	printf("shaped:     %6.1f dB, in band %6.1f dB, mean %+7.2f\n", shaped.power, shaped.inBand, shaped.mean);
+
+	errors += Check(dithered.power < truncated.power, "TPDF noise below truncation");
+	errors += Check(dithered.power > -52.0, "TPDF noise plausible (dither present)");
+	errors += Check(fabs(dithered.mean) < 16.0, "TPDF mean error within 16 LSBs");
+	errors += Check(fabs(shaped.mean) < 16.0, "shaped mean error within 16 LSBs");
+	errors += Check(shaped.inBand < dithered.inBand - 6.0, "noise shaping lowers in band noise by 6+ dB");
+
+	AtariSoundSetupRequantize(extremes, clipped, &spec, 1);
+	errors += Check(clipped[0] == 127 && clipped[2] == 127
+		&& clipped[1] <= -127 && clipped[3] <= -127, "full scale input clips instead of wrapping");
+
+	errors += Check(CheckVolume(), "software volume is fused (stereo, unsigned, -6 dB)");
+
+	return errors ? 1 : 0;
+}
@@ -66,9 +66,34 @@ typedef struct {
 	uint32_t	size;		/* buffer size (calculated) */
 } AudioSpec;
 
+typedef enum {
+	AudioMachineSt,
+	AudioMachineSte,
+	AudioMachineTt,
+	AudioMachineFalcon,
+
+	AudioMachineCount
+} AudioMachine;
+
 int AtariSoundSetupInitXbios(const AudioSpec* desired, AudioSpec* obtained);
 int AtariSoundSetupDeinitXbios(void);
 
+int AtariSoundSetupInitPsg(const AudioSpec* desired, AudioSpec* obtained);
+int AtariSoundSetupDeinitPsg(void);
+int AtariSoundSetupPsgSetbuffer(const void* begin, const void* end);
+int AtariSoundSetupPsgBuffoper(int mode);
+const void* AtariSoundSetupPsgBuffptr(void);
+
+int AtariSoundSetupInitOffline(const AudioSpec* desired, AudioSpec* obtained, AudioMachine machine, const char* filename);
+int AtariSoundSetupInitOfflineMemory(const AudioSpec* desired, AudioSpec* obtained, AudioMachine machine, void* memory, uint32_t capacity, uint32_t* length);
+int AtariSoundSetupWriteOffline(const void* buffer);
+int AtariSoundSetupDeinitOffline(void);
+
+int AtariSoundSetupSetVolume(int volume, int balance);
+void AtariSoundSetupApplyVolume(void* buffer, const AudioSpec* spec);
+
+void AtariSoundSetupRequantize(const int16_t* src, void* dst, const AudioSpec* spec, int noiseShaping);
+
 /******************************************************************************/
 
 #ifndef __mcoldfire__
@@ -333,6 +358,162 @@ static int DetectFormat(
 	return found;
 }
 
+enum {
+	MCH_ST = 0,
+	MCH_STE,
+	MCH_TT_OR_HADES,
+	MCH_FALCON,
+	MCH_MILAN,
+	MCH_ARANYM
+};
+
+struct FrequencySetting {
+	int frequency;
+	int clk;			/* clock for Devconnect() */
+	int prescale;		/* prescale for Devconnect() */
+	int prescaleOld;	/* prescale for Soundcmd(SETPRESCALE), -1 if prescale != CLKOLD */
+	int clkType;		/* 0: internal, 1: external 44.1 kHz, 2: external 48 kHz */
+};
+
+static int CheckSpec(const AudioSpec* desired, const AudioSpec* obtained) {
+	if (!desired || !obtained)
+		return 0;
+
+	if (desired->frequency == 0 || desired->frequency > 64000
+		|| desired->channels == 0 || desired->channels > 2
+		|| desired->format >= AudioFormatCount
+		|| desired->samples == 0)
+		return 0;
+
+	return 1;
+}
+
+static int DetectFrequency(
+	long mch,
+	long snd,
+	int isXSound,
+	int extClock1,
+	int extClock2,
+	const AudioSpec* desired,
+	struct FrequencySetting* frequencySetting) {
+	static const struct FrequencySetting frequencies[] = {
+		/* STE/TT */
+		{ 50066, CLK25M, CLKOLD,  PRE160, 0 },
+		{ 25033, CLK25M, CLKOLD,  PRE320, 0 },
+		{ 12517, CLK25M, CLKOLD,  PRE640, 0 },
+		{  6258, CLK25M, CLKOLD, PRE1280, 0 },
+		/* Falcon */
+		{ 49170, CLK25M, CLK50K, -1, 0 },
+		{ 32780, CLK25M, CLK33K, -1, 0 },
+		{ 24585, CLK25M, CLK25K, -1, 0 },
+		{ 19668, CLK25M, CLK20K, -1, 0 },
+		{ 16390, CLK25M, CLK16K, -1, 0 },
+		{ 12292, CLK25M, CLK12K, -1, 0 },
+		{  9834, CLK25M, CLK10K, -1, 0 },
+		{  8195, CLK25M, CLK8K,  -1, 0 },
+		/* CD */
+		{ 44100, CLKEXT, CLK50K, -1, 1 },
+		{ 29400, CLKEXT, CLK33K, -1, 1 },
+		{ 22050, CLKEXT, CLK25K, -1, 1 },
+		{ 17640, CLKEXT, CLK20K, -1, 1 },
+		{ 14700, CLKEXT, CLK16K, -1, 1 },
+		{ 11025, CLKEXT, CLK12K, -1, 1 },
+		{  8820, CLKEXT, CLK10K, -1, 1 },
+		{  7350, CLKEXT, CLK8K,  -1, 1 },
+		/* DAT */
+		{ 48000, CLKEXT, CLK50K, -1, 2 },
+		{ 32000, CLKEXT, CLK33K, -1, 2 },
+		{ 24000, CLKEXT, CLK25K, -1, 2 },
+		{ 19200, CLKEXT, CLK20K, -1, 2 },
+		{ 16000, CLKEXT, CLK16K, -1, 2 },
+		{ 12000, CLKEXT, CLK12K, -1, 2 },
+		{  9600, CLKEXT, CLK10K, -1, 2 },
+		{  8000, CLKEXT, CLK8K,  -1, 2 }
+	};
+	int i;
+
+	frequencySetting->frequency = 0;
+
+	for (i = 0; i < (int)(sizeof(frequencies) / sizeof(frequencies[0])); i++) {
+		/* assume that SND_16BIT implies availability of Falcon frequencies */
+		if (frequencies[i].prescale != CLKOLD && !(snd & SND_16BIT))
+			continue;
+
+		/* skip 6258 Hz if on Falcon */
+		if ((mch == MCH_FALCON || mch == MCH_ARANYM) && frequencies[i].prescale == CLKOLD && frequencies[i].prescaleOld == PRE1280)
+			continue;
+
+		/* skip external clock frequencies if not present */
+		if (frequencies[i].clkType != 0 && frequencies[i].clkType != extClock1 && frequencies[i].clkType != extClock2)
+			continue;
+
+		if (frequencySetting->frequency == 0
+			|| abs(frequencies[i].frequency - desired->frequency) < abs(frequencySetting->frequency - desired->frequency)) {
+			*frequencySetting = frequencies[i];
+
+			if (isXSound && frequencySetting->prescale == CLKOLD && !(snd & SND_16BIT)) {
+				/*
+				 * hack for X-SOUND which doesn't understand SETPRESCALE
+				 * and yet happily pretends that Falcon frequencies are
+				 * STE/TT ones
+				 */
+				switch (frequencySetting->prescaleOld) {
+				case PRE160:
+					frequencySetting->prescale = CLK50K;
+					break;
+				case PRE320:
+					frequencySetting->prescale = CLK25K;
+					break;
+				case PRE640:
+					frequencySetting->prescale = CLK12K;
+					break;
+				case PRE1280:
+					frequencySetting->prescale = 15;	/* "6146 Hz" (illegal on Falcon)" */
+					break;
+				}
+				frequencySetting->prescaleOld = -1;
+			}
+		}
+	}
+
+	return frequencySetting->frequency != 0;
+}
+
+static void DetectChannels(
+	int has8bitStereo,
+	int has16bitMono,
+	const AudioSpec* desired,
+	AudioSpec* obtained) {
+	if (desired->channels == 1
+		&& obtained->format != AudioFormatSigned8
+		&& obtained->format != AudioFormatUnsigned8
+		&& !has16bitMono) {
+		/* Falcon and FireBee lack 16-bit mono */
+		obtained->channels = 2;
+	} else if (desired->channels == 2
+		&& (obtained->format == AudioFormatSigned8 || obtained->format == AudioFormatUnsigned8)
+		&& !has8bitStereo) {
+		/* ST emulation lacks 8-bit stereo */
+		obtained->channels = 1;
+	} else {
+		obtained->channels = desired->channels;
+	}
+}
+
+static void CalculateSize(const AudioSpec* desired, AudioSpec* obtained) {
+	/* (lag in ms) = (samples / frequency) * 1000 */
+	obtained->samples = desired->samples;
+	while (obtained->samples * 16 > obtained->frequency * 2)
+		obtained->samples >>= 1;
+
+	obtained->size = obtained->samples * obtained->channels;
+	if (obtained->format != AudioFormatSigned8
+		&& obtained->format != AudioFormatUnsigned8) {
+		/* 16-bit samples */
+		obtained->size *= 2;
+	}
+}
+
 static int locked;
 static int oldGpio;
 static int oldLtAtten;
@@ -342,16 +523,14 @@ static int oldRtGain;
 static int oldAdderIn;
 static int oldAdcInput;
 static int oldPrescale;
+static int hasAttenuation;
+static int attenuationCurrent[2];	/* LTATTEN/RTATTEN steps as set */
+static int attenuationTarget[2];	/* LTATTEN/RTATTEN steps as requested */
+
+static void VolumeUpdate(void);
+static void RequantizeBuildNoise(void);
 
 int AtariSoundSetupInitXbios(const AudioSpec* desired, AudioSpec* obtained) {
-	enum {
-		MCH_ST = 0,
-		MCH_STE,
-		MCH_TT_OR_HADES,
-		MCH_FALCON,
-		MCH_MILAN,
-		MCH_ARANYM
-	};
 	long mch;
 	long snd;
 	long mcsn = 0;
@@ -363,13 +542,7 @@ int AtariSoundSetupInitXbios(const AudioSpec* desired, AudioSpec* obtained) {
 	int extClock1 = 0;
 	int extClock2 = 0;
 
-	if (!desired || !obtained)
-		return 0;
-
-	if (desired->frequency == 0 || desired->frequency > 64000
-		|| desired->channels == 0 || desired->channels > 2
-		|| desired->format >= AudioFormatCount
-		|| desired->samples == 0)
+	if (!CheckSpec(desired, obtained))
 		return 0;
 
 	/* this tests presence of an XBIOS, too */
@@ -538,94 +711,9 @@ int AtariSoundSetupInitXbios(const AudioSpec* desired, AudioSpec* obtained) {
 		Devconnect(DMAPLAY, DAC, CLK25M, CLKOLD, NO_SHAKE);
 		obtained->frequency = Soundcmd(SETSMPFREQ, desired->frequency);
 	} else {
-		struct FrequencySetting {
-			int frequency;
-			int clk;			/* clock for Devconnect() */
-			int prescale;		/* prescale for Devconnect() */
-			int prescaleOld;	/* prescale for Soundcmd(SETPRESCALE), -1 if prescale != CLKOLD */
-			int clkType;		/* 0: internal, 1: external 44.1 kHz, 2: external 48 kHz */
-		};
+		struct FrequencySetting frequencySetting;
 
-		static const struct FrequencySetting frequencies[] = {
-			/* STE/TT */
-			{ 50066, CLK25M, CLKOLD,  PRE160, 0 },
-			{ 25033, CLK25M, CLKOLD,  PRE320, 0 },
-			{ 12517, CLK25M, CLKOLD,  PRE640, 0 },
-			{  6258, CLK25M, CLKOLD, PRE1280, 0 },
-			/* Falcon */
-			{ 49170, CLK25M, CLK50K, -1, 0 },
-			{ 32780, CLK25M, CLK33K, -1, 0 },
-			{ 24585, CLK25M, CLK25K, -1, 0 },
-			{ 19668, CLK25M, CLK20K, -1, 0 },
-			{ 16390, CLK25M, CLK16K, -1, 0 },
-			{ 12292, CLK25M, CLK12K, -1, 0 },
-			{  9834, CLK25M, CLK10K, -1, 0 },
-			{  8195, CLK25M, CLK8K,  -1, 0 },
-			/* CD */
-			{ 44100, CLKEXT, CLK50K, -1, 1 },
-			{ 29400, CLKEXT, CLK33K, -1, 1 },
-			{ 22050, CLKEXT, CLK25K, -1, 1 },
-			{ 17640, CLKEXT, CLK20K, -1, 1 },
-			{ 14700, CLKEXT, CLK16K, -1, 1 },
-			{ 11025, CLKEXT, CLK12K, -1, 1 },
-			{  8820, CLKEXT, CLK10K, -1, 1 },
-			{  7350, CLKEXT, CLK8K,  -1, 1 },
-			/* DAT */
-			{ 48000, CLKEXT, CLK50K, -1, 2 },
-			{ 32000, CLKEXT, CLK33K, -1, 2 },
-			{ 24000, CLKEXT, CLK25K, -1, 2 },
-			{ 19200, CLKEXT, CLK20K, -1, 2 },
-			{ 16000, CLKEXT, CLK16K, -1, 2 },
-			{ 12000, CLKEXT, CLK12K, -1, 2 },
-			{  9600, CLKEXT, CLK10K, -1, 2 },
-			{  8000, CLKEXT, CLK8K,  -1, 2 }
-		};
-		struct FrequencySetting frequencySetting = { 0, 0, 0, 0, 0 };
-		int i;
-
-		for (i = 0; i < (int)(sizeof(frequencies) / sizeof(frequencies[0])); i++) {
-			/* assume that SND_16BIT implies availability of Falcon frequencies */
-			if (frequencies[i].prescale != CLKOLD && !(snd & SND_16BIT))
-				continue;
-
-			/* skip 6258 Hz if on Falcon */
-			if ((mch == MCH_FALCON || mch == MCH_ARANYM) && frequencies[i].prescale == CLKOLD && frequencies[i].prescaleOld == PRE1280)
-				continue;
-
-			/* skip external clock frequencies if not present */
-			if (frequencies[i].clkType != 0 && frequencies[i].clkType != extClock1 && frequencies[i].clkType != extClock2)
-				continue;
-
-			if (frequencySetting.frequency == 0
-				|| abs(frequencies[i].frequency - desired->frequency) < abs(frequencySetting.frequency - desired->frequency)) {
-				frequencySetting = frequencies[i];
-
-				if (mcsn && frequencySetting.prescale == CLKOLD && !(snd & SND_16BIT)) {
-					/*
-					 * hack for X-SOUND which doesn't understand SETPRESCALE
-					 * and yet happily pretends that Falcon frequencies are
-					 * STE/TT ones
-					 */
-					switch (frequencySetting.prescaleOld) {
-					case PRE160:
-						frequencySetting.prescale = CLK50K;
-						break;
-					case PRE320:
-						frequencySetting.prescale = CLK25K;
-						break;
-					case PRE640:
-						frequencySetting.prescale = CLK12K;
-						break;
-					case PRE1280:
-						frequencySetting.prescale = 15;	/* "6146 Hz" (illegal on Falcon)" */
-						break;
-					}
-					frequencySetting.prescaleOld = -1;
-				}
-			}
-		}
-
-		if (!frequencySetting.frequency) {
+		if (!DetectFrequency(mch, snd, mcsn != 0, extClock1, extClock2, desired, &frequencySetting)) {
 			AtariSoundSetupDeinitXbios();
 			return 0;
 		}
@@ -651,20 +739,7 @@ int AtariSoundSetupInitXbios(const AudioSpec* desired, AudioSpec* obtained) {
 			Soundcmd(SETPRESCALE, frequencySetting.prescaleOld);
 	}
 
-	if (desired->channels == 1
-		&& obtained->format != AudioFormatSigned8
-		&& obtained->format != AudioFormatUnsigned8
-		&& !has16bitMono) {
-		/* Falcon and FireBee lack 16-bit mono */
-		obtained->channels = 2;
-	} else if (desired->channels == 2
-		&& (obtained->format == AudioFormatSigned8 || obtained->format == AudioFormatUnsigned8)
-		&& !has8bitStereo) {
-		/* ST emulation lacks 8-bit stereo */
-		obtained->channels = 1;
-	} else {
-		obtained->channels = desired->channels;
-	}
+	DetectChannels(has8bitStereo, has16bitMono, desired, obtained);
 
 	switch (obtained->format) {
 		case AudioFormatSigned8:
@@ -715,17 +790,18 @@ int AtariSoundSetupInitXbios(const AudioSpec* desired, AudioSpec* obtained) {
 
 	Soundcmd(ADDERIN, MATIN);	/* set matrix to the adder */
 
-	/* (lag in ms) = (samples / frequency) * 1000 */
-	obtained->samples = desired->samples;
-	while (obtained->samples * 16 > obtained->frequency * 2)
-		obtained->samples >>= 1;
-
-	obtained->size = obtained->samples * obtained->channels;
-	if (obtained->format != AudioFormatSigned8
-		&& obtained->format != AudioFormatUnsigned8) {
-		/* 16-bit samples */
-		obtained->size *= 2;
+	/* Falcon compatible codec (LTATTEN/RTATTEN are no-ops elsewhere) */
+	hasAttenuation = (snd & SND_MATRIX) != 0;
+	attenuationCurrent[0] = attenuationCurrent[1] = 0;
+	attenuationTarget[0] = attenuationTarget[1] = 0;
+	if (hasAttenuation) {
+		Soundcmd(LTATTEN, 0);
+		Soundcmd(RTATTEN, 0);
 	}
+	VolumeUpdate();
+
+	CalculateSize(desired, obtained);
+	RequantizeBuildNoise();
 
 	return 1;
 }
@@ -747,6 +823,12 @@ int AtariSoundSetupDeinitXbios(void) {
 		Soundcmd(ADCINPUT, oldAdcInput);
 		Soundcmd(SETPRESCALE, oldPrescale);
 
+		/* back to software volume for whatever comes next (PSG, offline) */
+		hasAttenuation = 0;
+		attenuationCurrent[0] = attenuationCurrent[1] = 0;
+		attenuationTarget[0] = attenuationTarget[1] = 0;
+		VolumeUpdate();
+
 		Unlocksnd();
 		return 1;
 	}
@@ -754,4 +836,934 @@ int AtariSoundSetupDeinitXbios(void) {
 	return 0;
 }
 
+/******************************************************************************/
+
+/* MFP timer A in delay mode with a 1:4 prescaler (2.4576 MHz / 4) */
+#define PSG_TIMER_CLOCK		614400L
+/* 9600 Hz; see the cycle budget in PsgTimerA() */
+#define PSG_TIMER_DATA_MIN	64
+#define PSG_TIMER_DATA_MAX	255
+
+static void DetectPsg(const AudioSpec* desired, AudioSpec* obtained, int* timerData) {
+	int data;
+
+	switch (desired->format) {
+		case AudioFormatSigned8:
+		case AudioFormatSigned16LSB:
+		case AudioFormatSigned16MSB:
+			obtained->format = AudioFormatSigned8;
+			break;
+		case AudioFormatUnsigned8:
+		case AudioFormatUnsigned16LSB:
+		case AudioFormatUnsigned16MSB:
+		case AudioFormatCount:
+			obtained->format = AudioFormatUnsigned8;
+			break;
+	}
+
+	obtained->channels = 1;
+
+	data = (PSG_TIMER_CLOCK + desired->frequency / 2) / desired->frequency;
+	if (data < PSG_TIMER_DATA_MIN)
+		data = PSG_TIMER_DATA_MIN;
+	else if (data > PSG_TIMER_DATA_MAX)
+		data = PSG_TIMER_DATA_MAX;
+
+	obtained->frequency = PSG_TIMER_CLOCK / data;
+	*timerData = data;
+}
+
+/* plain C, so the host tests in test/ can build it, too */
+#if !defined(__mcoldfire__) || defined(USOUND_HOST_TEST)
+/* per sample value: { 0x08, volume A, 0x09, volume B, 0x0A, volume C, 0, 0 } */
+static uint16_t psgTable[256][4];
+
+static void PsgBuildTable(int isSigned) {
+	/* nominal YM2149 DAC levels: -3 dB per step, 0 is silence */
+	static const long levels[16] = {
+		0, 64, 91, 128, 181, 256, 362, 512, 724, 1024, 1448, 2048, 2896, 4096, 5793, 8192
+	};
+	const long maxSum = 3 * 8192;
+	const int flip = isSigned ? 0x80 : 0x00;
+	long bestError[256];
+	int a, b, c;
+	int i;
+
+	for (i = 0; i < 256; i++)
+		bestError[i] = -1;
+
+	/* channels are interchangeable so a >= b >= c is enough */
+	for (a = 0; a < 16; a++) {
+		for (b = 0; b <= a; b++) {
+			for (c = 0; c <= b; c++) {
+				long sum = levels[a] + levels[b] + levels[c];
+				int target = (sum * 255 + maxSum / 2) / maxSum;
+				long error = labs(sum * 255 - target * maxSum);
+
+				if (bestError[target] < 0 || error < bestError[target]) {
+					bestError[target] = error;
+					psgTable[target ^ flip][0] = 0x0800 | a;
+					psgTable[target ^ flip][1] = 0x0900 | b;
+					psgTable[target ^ flip][2] = 0x0A00 | c;
+					psgTable[target ^ flip][3] = 0;
+				}
+			}
+		}
+	}
+
+	/* not every level can be reached; use the nearest one which can */
+	for (i = 0; i < 256; i++) {
+		int d;
+
+		if (bestError[i] >= 0)
+			continue;
+
+		for (d = 1; d < 256; d++) {
+			if (i - d >= 0 && bestError[i - d] >= 0) {
+				memcpy(psgTable[i ^ flip], psgTable[(i - d) ^ flip], sizeof(psgTable[0]));
+				break;
+			}
+			if (i + d < 256 && bestError[i + d] >= 0) {
+				memcpy(psgTable[i ^ flip], psgTable[(i + d) ^ flip], sizeof(psgTable[0]));
+				break;
+			}
+		}
+	}
+}
+#endif
+
+#ifndef __mcoldfire__
+static const uint8_t* volatile psgBegin;
+static const uint8_t* volatile psgEnd;
+static const uint8_t* volatile psgNextBegin;	/* taken over at the end of the current buffer */
+static const uint8_t* volatile psgNextEnd;
+static const uint8_t* volatile psgPos;
+static volatile int16_t psgRepeat;
+static volatile int16_t psgPlaying;
+
+static void __attribute__((interrupt_handler)) PsgTimerA(void) {
+	/*
+	 * Cycle budget per sample on a 68000 (ignoring ST bus alignment):
+	 *
+	 *  44  interrupt exception
+	 *  40  movem.l d0-d1/a0-a1,-(sp) (generated by gcc)
+	 * 116  sample fetch, end of buffer check, table lookup
+	 *  72  3x YM2149 register select & write (movep.l + movep.w)
+	 *  16  end of interrupt
+	 *  44  movem.l (sp)+,d0-d1/a0-a1 (generated by gcc)
+	 *  20  rte
+	 * ---
+	 * 352  i.e. ~42% of an 8 MHz ST at 9600 Hz, ~27% at 6144 Hz
+	 *
+	 * Once per buffer, the switch to the next buffer adds 100 cycles.
+	 */
+	__asm__ volatile(
+		"	move.l	%[pos],%%a0\n"
+		"	moveq	#0,%%d0\n"
+		"	move.b	(%%a0)+,%%d0\n"
+		"	cmp.l	%[end],%%a0\n"
+		"	bcs.s	1f\n"
+		"	move.l	%[nextBegin],%%a0\n"	/* like the DMA: switch to the next buffer */
+		"	move.l	%%a0,%[begin]\n"
+		"	move.l	%[nextEnd],%[end]\n"
+		"	tst.w	%[repeat]\n"
+		"	bne.s	1f\n"
+		"	clr.b	0xfffffa19.w\n"		/* TACR: stop timer A */
+		"	clr.w	%[playing]\n"
+		"1:\n"
+		"	move.l	%%a0,%[pos]\n"
+		"	lsl.w	#3,%%d0\n"
+		"	lea		%[table],%%a0\n"
+		"	lea		0xffff8800.w,%%a1\n"
+		"	move.l	(0,%%a0,%%d0.w),%%d1\n"
+		"	movep.l	%%d1,(0,%%a1)\n"	/* volume A, volume B */
+		"	move.w	(4,%%a0,%%d0.w),%%d1\n"
+		"	movep.w	%%d1,(0,%%a1)\n"	/* volume C */
+		"	move.b	#0xdf,0xfffffa0f.w\n"	/* ISRA: clear in-service bit of timer A */
+
+		: [pos] "+m"(psgPos), [begin] "+m"(psgBegin), [end] "+m"(psgEnd), [playing] "+m"(psgPlaying)	/* outputs */
+		: [nextBegin] "m"(psgNextBegin), [nextEnd] "m"(psgNextEnd), [repeat] "m"(psgRepeat), [table] "m"(psgTable[0][0])	/* inputs */
+		: "d0", "d1", "a0", "a1", "cc", "memory"
+	);
+}
+
+static uint8_t oldConterm;
+
+static long PsgDisableKeyclick(void) {
+	volatile uint8_t* conterm = (volatile uint8_t*)0x484;
+
+	/* keyclick and bell would overwrite the volume registers */
+	oldConterm = *conterm;
+	*conterm &= ~0x05;
+	return 0;
+}
+
+static long PsgRestoreKeyclick(void) {
+	*(volatile uint8_t*)0x484 = oldConterm;
+	return 0;
+}
+
+static const uint8_t* psgRequestBegin;
+static const uint8_t* psgRequestEnd;
+
+static long PsgQueueBuffer(void) {
+	uint16_t sr;
+
+	/* IPL 6 masks the MFP without dropping a pending timer A request (unlike Jdisint()) */
+	__asm__ volatile(
+		"	move.w	%%sr,%0\n"
+		"	or.w	#0x0600,%%sr\n"
+		: "=d"(sr)
+		:
+		: "cc", "memory"
+	);
+
+	/* same as Setbuffer(): the current buffer is played until its end */
+	psgNextBegin = psgRequestBegin;
+	psgNextEnd = psgRequestEnd;
+
+	if (!psgPlaying) {
+		psgBegin = psgNextBegin;
+		psgEnd = psgNextEnd;
+		psgPos = psgBegin;
+	}
+
+	__asm__ volatile(
+		"	move.w	%0,%%sr\n"
+		:
+		: "d"(sr)
+		: "cc", "memory"
+	);
+
+	return 0;
+}
+
+static void PsgStopTimer(void) {
+	Xbtimer(0, 0, 0, PsgTimerA);	/* TACR = 0: timer A stopped */
+	Jdisint(13);
+	psgPlaying = 0;
+}
+
+static int psgLocked;
+static int psgTimerData;
+static long oldTimerA;
+static int oldPsgMixer;
+static int oldPsgVolume[3];
+
+int AtariSoundSetupInitPsg(const AudioSpec* desired, AudioSpec* obtained) {
+	long snd;
+	int i;
+
+	if (psgLocked || !CheckSpec(desired, obtained))
+		return 0;
+
+	snd = SND_PSG;
+	Getcookie(C__SND, &snd);
+
+	if (!(snd & SND_PSG))
+		return 0;
+
+	DetectPsg(desired, obtained, &psgTimerData);
+	CalculateSize(desired, obtained);
+
+	PsgBuildTable(obtained->format == AudioFormatSigned8);
+	RequantizeBuildNoise();
+
+	psgBegin = psgEnd = psgPos = NULL;
+	psgNextBegin = psgNextEnd = NULL;
+	psgRepeat = 0;
+	psgPlaying = 0;
+
+	psgLocked = 1;
+	oldTimerA = (long)Setexc(0x134 / 4, -1L);
+	oldPsgMixer = Giaccess(0, 7);
+	for (i = 0; i < 3; i++)
+		oldPsgVolume[i] = Giaccess(0, 8 + i);
+
+	Supexec(PsgDisableKeyclick);
+
+	/* tone and noise off (port directions kept), i.e. the volume registers act as a DAC */
+	Giaccess((oldPsgMixer & 0xC0) | 0x3F, 7 | 0x80);
+	for (i = 0; i < 3; i++)
+		Giaccess(0, (8 + i) | 0x80);
+
+	return 1;
+}
+
+int AtariSoundSetupDeinitPsg(void) {
+	if (psgLocked) {
+		int i;
+
+		psgLocked = 0;
+
+		PsgStopTimer();
+		Setexc(0x134 / 4, oldTimerA);
+
+		for (i = 0; i < 3; i++)
+			Giaccess(oldPsgVolume[i], (8 + i) | 0x80);
+		Giaccess(oldPsgMixer, 7 | 0x80);
+
+		Supexec(PsgRestoreKeyclick);
+		return 1;
+	}
+
+	return 0;
+}
+
+int AtariSoundSetupPsgSetbuffer(const void* begin, const void* end) {
+	if (!psgLocked || !begin || (const uint8_t*)end <= (const uint8_t*)begin)
+		return 0;
+
+	psgRequestBegin = (const uint8_t*)begin;
+	psgRequestEnd = (const uint8_t*)end;
+	Supexec(PsgQueueBuffer);
+
+	return 1;
+}
+
+int AtariSoundSetupPsgBuffoper(int mode) {
+	if (!psgLocked)
+		return 0;
+
+	if (mode < 0)
+		return (psgPlaying ? SB_PLA_ENA : 0) | (psgRepeat ? SB_PLA_RPT : 0);
+
+	PsgStopTimer();
+	psgRepeat = (mode & SB_PLA_RPT) != 0;
+
+	if ((mode & SB_PLA_ENA) && psgBegin) {
+		psgPlaying = 1;
+		Xbtimer(0, 1, psgTimerData, PsgTimerA);	/* timer A, delay mode /4 */
+	}
+
+	return 1;
+}
+
+const void* AtariSoundSetupPsgBuffptr(void) {
+	return psgPos;
+}
+#else
+/* the FireBee has no YM2149 */
+int AtariSoundSetupInitPsg(const AudioSpec* desired, AudioSpec* obtained) {
+	(void)desired;
+	(void)obtained;
+	return 0;
+}
+
+int AtariSoundSetupDeinitPsg(void) {
+	return 0;
+}
+
+int AtariSoundSetupPsgSetbuffer(const void* begin, const void* end) {
+	(void)begin;
+	(void)end;
+	return 0;
+}
+
+int AtariSoundSetupPsgBuffoper(int mode) {
+	(void)mode;
+	return 0;
+}
+
+const void* AtariSoundSetupPsgBuffptr(void) {
+	return NULL;
+}
+#endif	/* !__mcoldfire__ */
+
+/******************************************************************************/
+
+static void PutLe16(uint8_t* p, uint16_t value) {
+	p[0] = value;
+	p[1] = value >> 8;
+}
+
+static void PutLe32(uint8_t* p, uint32_t value) {
+	PutLe16(p, value);
+	PutLe16(p + 2, value >> 16);
+}
+
+static int offline;
+static short offlineHandle;
+static uint8_t* offlineMemory;		/* NULL: file sink */
+static uint32_t offlineCapacity;
+static uint32_t* offlineLength;
+static AudioSpec offlineSpec;
+static uint32_t offlineDataSize;
+
+static int OfflineNegotiate(const AudioSpec* desired, AudioSpec* obtained, AudioMachine machine) {
+	struct MachineProfile {
+		long mch;
+		long snd;
+		int signed8;		/* AudioFormatSigned8 available */
+		int signed16MSB;	/* AudioFormatSigned16MSB available */
+	};
+
+	/*
+	 * What _SND looks like with a sound XBIOS present: TOS 4 on the Falcon,
+	 * EmuTOS (or a non-emulating STFA) on the STE/TT. Stock STE/TT TOS has
+	 * no sound XBIOS, so AtariSoundSetupInitXbios() would fail there.
+	 * The ST profile models the YM2149 fallback.
+	 */
+	static const struct MachineProfile profiles[AudioMachineCount] = {
+		{ MCH_ST,          SND_PSG,                        0, 0 },
+		{ MCH_STE,         SND_PSG | SND_8BIT,             1, 0 },
+		{ MCH_TT_OR_HADES, SND_PSG | SND_8BIT,             1, 0 },
+		{ MCH_FALCON,      SND_PSG | SND_8BIT | SND_16BIT, 1, 1 }
+	};
+	const struct MachineProfile* profile;
+	int formatsAvailable[AudioFormatCount] = { 0 };
+	struct FrequencySetting frequencySetting;
+
+	if (offline || !CheckSpec(desired, obtained) || machine >= AudioMachineCount)
+		return 0;
+
+	profile = &profiles[machine];
+	formatsAvailable[AudioFormatSigned8]     = profile->signed8;
+	formatsAvailable[AudioFormatSigned16MSB] = profile->signed16MSB;
+
+	if (!(profile->snd & (SND_8BIT | SND_16BIT))) {
+		/* same decisions as AtariSoundSetupInitPsg() takes */
+		int timerData;
+
+		DetectPsg(desired, obtained, &timerData);
+	} else {
+		/* same decisions as AtariSoundSetupInitXbios() takes with such an XBIOS (no external clocks) */
+		if (!DetectFormat(formatsAvailable, desired, obtained))
+			return 0;
+
+		if (!DetectFrequency(profile->mch, profile->snd, 0, 0, 0, desired, &frequencySetting))
+			return 0;
+
+		obtained->frequency = frequencySetting.frequency;
+
+		DetectChannels(1, 0, desired, obtained);
+	}
+
+	CalculateSize(desired, obtained);
+	RequantizeBuildNoise();
+
+	return 1;
+}
+
+static int OfflineOutput(const void* data, uint32_t count) {
+	if (offlineMemory) {
+		if (count > offlineCapacity - *offlineLength)
+			return 0;
+
+		memcpy(offlineMemory + *offlineLength, data, count);
+		*offlineLength += count;
+		return 1;
+	}
+
+	return Fwrite(offlineHandle, count, data) == (long)count;
+}
+
+static int OfflinePatch(uint32_t offset, uint32_t value) {
+	uint8_t bytes[4];
+
+	if (offlineMemory) {
+		PutLe32(offlineMemory + offset, value);
+		return 1;
+	}
+
+	PutLe32(bytes, value);
+	return Fseek(offset, offlineHandle, 0) == (long)offset && Fwrite(offlineHandle, 4, bytes) == 4;
+}
+
+static int OfflineBegin(const AudioSpec* obtained) {
+	uint8_t header[44];
+
+	offlineSpec = *obtained;
+	offlineDataSize = 0;
+
+	/* canonical RIFF/WAVE header; sizes are patched in AtariSoundSetupDeinitOffline() */
+	memcpy(&header[0], "RIFF", 4);
+	PutLe32(&header[4], 36);
+	memcpy(&header[8], "WAVEfmt ", 8);
+	PutLe32(&header[16], 16);
+	PutLe16(&header[20], 1);	/* PCM */
+	PutLe16(&header[22], obtained->channels);
+	PutLe32(&header[24], obtained->frequency);
+	PutLe32(&header[28], obtained->frequency * (obtained->size / obtained->samples));
+	PutLe16(&header[32], obtained->size / obtained->samples);
+	PutLe16(&header[34], (obtained->format == AudioFormatSigned8 || obtained->format == AudioFormatUnsigned8) ? 8 : 16);
+	memcpy(&header[36], "data", 4);
+	PutLe32(&header[40], 0);
+
+	if (!OfflineOutput(header, sizeof(header)))
+		return 0;
+
+	offline = 1;
+	return 1;
+}
+
+int AtariSoundSetupInitOffline(const AudioSpec* desired, AudioSpec* obtained, AudioMachine machine, const char* filename) {
+	long ret;
+
+	if (!filename || !OfflineNegotiate(desired, obtained, machine))
+		return 0;
+
+	ret = Fcreate(filename, 0);
+	if (ret < 0)
+		return 0;
+
+	offlineHandle = (short)ret;
+	offlineMemory = NULL;
+
+	if (!OfflineBegin(obtained)) {
+		Fclose(offlineHandle);
+		return 0;
+	}
+
+	return 1;
+}
+
+int AtariSoundSetupInitOfflineMemory(const AudioSpec* desired, AudioSpec* obtained, AudioMachine machine, void* memory, uint32_t capacity, uint32_t* length) {
+	if (!memory || !length || !OfflineNegotiate(desired, obtained, machine))
+		return 0;
+
+	offlineMemory = (uint8_t*)memory;
+	offlineCapacity = capacity;
+	offlineLength = length;
+	*offlineLength = 0;
+
+	return OfflineBegin(obtained);
+}
+
+int AtariSoundSetupWriteOffline(const void* buffer) {
+	const uint8_t* src = (const uint8_t*)buffer;
+	uint8_t chunk[512];
+	uint32_t remaining;
+	int swap = 0;
+	uint8_t xorEven = 0;
+	uint8_t xorOdd = 0;
+
+	if (!offline || !buffer)
+		return 0;
+
+	/* WAV wants unsigned 8-bit and signed little endian 16-bit samples */
+	switch (offlineSpec.format) {
+		case AudioFormatSigned8:
+			xorEven = xorOdd = 0x80;
+			break;
+		case AudioFormatSigned16MSB:
+			swap = 1;
+			break;
+		case AudioFormatUnsigned16LSB:
+			xorOdd = 0x80;
+			break;
+		case AudioFormatUnsigned16MSB:
+			swap = 1;
+			xorOdd = 0x80;
+			break;
+		case AudioFormatUnsigned8:
+		case AudioFormatSigned16LSB:
+		case AudioFormatCount:
+			break;
+	}
+
+	remaining = offlineSpec.size;
+	while (remaining > 0) {
+		uint32_t count = remaining < sizeof(chunk) ? remaining : sizeof(chunk);
+		const void* out = src;
+
+		if (swap || xorEven || xorOdd) {
+			uint32_t i;
+
+			for (i = 0; i < count; i++)
+				chunk[i] = src[i ^ swap] ^ ((i & 1) ? xorOdd : xorEven);
+
+			out = chunk;
+		}
+
+		if (!OfflineOutput(out, count))
+			return 0;
+
+		src += count;
+		remaining -= count;
+		offlineDataSize += count;
+	}
+
+	return 1;
+}
+
+int AtariSoundSetupDeinitOffline(void) {
+	if (offline) {
+		int ret = 1;
+
+		offline = 0;
+
+		if (!OfflinePatch(4, 36 + offlineDataSize) || !OfflinePatch(40, offlineDataSize))
+			ret = 0;
+
+		if (!offlineMemory && Fclose(offlineHandle) < 0)
+			ret = 0;
+
+		return ret;
+	}
+
+	return 0;
+}
+
+/******************************************************************************/
+
+/* current and requested software gain in 1/256 units (256: 0 dB) */
+static int volumeCurrent[2] = { 256, 256 };
+static int volumeTarget[2] = { 256, 256 };
+/* overall gain as passed to AtariSoundSetupSetVolume() */
+static int volumeRequested[2] = { 256, 256 };
+
+/* 256 * 10^(-1.5 * step / 20), i.e. LTATTEN/RTATTEN steps of -1.5 dB */
+static const int attenuationGains[16] = {
+	256, 215, 181, 152, 128, 108, 91, 76, 64, 54, 45, 38, 32, 27, 23, 19
+};
+
+static int AttenuationStep(int gain) {
+	int step;
+
+	for (step = 0; step < 15; step++) {
+		if (gain * 2 >= attenuationGains[step] + attenuationGains[step + 1])
+			break;
+	}
+
+	return step;
+}
+
+static void AttenuationRamp(void) {
+	int c;
+
+	if (!locked || !hasAttenuation)
+		return;
+
+	/*
+	 * One step (1.5 dB) per buffer, jumping several steps at once would click.
+	 * Each step is still instant (a small zipper) and, unlike the software
+	 * ramp of the same change, it isn't delayed by the buffer being played,
+	 * i.e. it is heard up to one buffer early.
+	 */
+	for (c = 0; c < 2; c++) {
+		if (attenuationCurrent[c] == attenuationTarget[c])
+			continue;
+
+		attenuationCurrent[c] += attenuationCurrent[c] < attenuationTarget[c] ? 1 : -1;
+		Soundcmd(c == 0 ? LTATTEN : RTATTEN, attenuationCurrent[c] << 4);
+	}
+}
+
+int AtariSoundSetupSetVolume(int volume, int balance) {
+	int gain[2];
+
+	if (volume < 0)
+		volume = 0;
+	else if (volume > 256)
+		volume = 256;
+
+	if (balance < -256)
+		balance = -256;
+	else if (balance > 256)
+		balance = 256;
+
+	/* balance only ever attenuates the opposite channel */
+	gain[0] = balance > 0 ? volume * (256 - balance) / 256 : volume;
+	gain[1] = balance < 0 ? volume * (256 + balance) / 256 : volume;
+
+	volumeRequested[0] = gain[0];
+	volumeRequested[1] = gain[1];
+	VolumeUpdate();
+
+	return locked && hasAttenuation;
+}
+
+/* splits the requested gain between the attenuators and software */
+static void VolumeUpdate(void) {
+	int c;
+
+	for (c = 0; c < 2; c++) {
+		if (locked && hasAttenuation) {
+			attenuationTarget[c] = AttenuationStep(volumeRequested[c]);
+
+			/* the codec can't go below -22.5 dB, the rest (down to silence) is done in software */
+			if (volumeRequested[c] < attenuationGains[15])
+				volumeTarget[c] = volumeRequested[c] * 256 / attenuationGains[15];
+			else
+				volumeTarget[c] = 256;
+		} else {
+			volumeTarget[c] = volumeRequested[c];
+		}
+	}
+}
+
+static int VolumeRampBegin(const AudioSpec* spec, long gain[2], long step[2]) {
+	int target[2];
+	int c;
+
+	AttenuationRamp();
+
+	if (volumeCurrent[0] == 256 && volumeCurrent[1] == 256
+		&& volumeTarget[0] == 256 && volumeTarget[1] == 256)
+		return 0;
+
+	target[0] = volumeTarget[0];
+	target[1] = volumeTarget[1];
+	if (spec->channels == 1)
+		target[0] = (target[0] + target[1] + 1) / 2;
+
+	/* linear ramp over the whole buffer, 16.16 fixed point */
+	for (c = 0; c < spec->channels; c++) {
+		if (spec->channels == 1)
+			volumeCurrent[c] = (volumeCurrent[0] + volumeCurrent[1] + 1) / 2;
+
+		gain[c] = (long)volumeCurrent[c] << 16;
+		step[c] = (long)(target[c] - volumeCurrent[c]) * 65536L / spec->samples;
+	}
+
+	return 1;
+}
+
+static void VolumeRampEnd(void) {
+	volumeCurrent[0] = volumeTarget[0];
+	volumeCurrent[1] = volumeTarget[1];
+}
+
+void AtariSoundSetupApplyVolume(void* buffer, const AudioSpec* spec) {
+	uint8_t* p = (uint8_t*)buffer;
+	long gain[2];
+	long step[2];
+	uint8_t xor;
+	uint16_t i;
+	int c;
+
+	if (!buffer || !spec || spec->samples == 0 || spec->channels == 0 || spec->channels > 2)
+		return;
+
+	if (!VolumeRampBegin(spec, gain, step))
+		return;
+
+	switch (spec->format) {
+		case AudioFormatSigned8:
+		case AudioFormatUnsigned8:
+			xor = spec->format == AudioFormatUnsigned8 ? 0x80 : 0x00;
+
+			for (i = 0; i < spec->samples; i++) {
+				for (c = 0; c < spec->channels; c++) {
+					int s = (int8_t)(*p ^ xor);
+
+					*p++ = (uint8_t)((s * (int)(gain[c] >> 16)) >> 8) ^ xor;
+					gain[c] += step[c];
+				}
+			}
+			break;
+
+		case AudioFormatSigned16LSB:
+		case AudioFormatSigned16MSB:
+		case AudioFormatUnsigned16LSB:
+		case AudioFormatUnsigned16MSB: {
+			int hi = (spec->format == AudioFormatSigned16LSB || spec->format == AudioFormatUnsigned16LSB) ? 1 : 0;
+			int lo = hi ^ 1;
+
+			xor = (spec->format == AudioFormatUnsigned16LSB || spec->format == AudioFormatUnsigned16MSB) ? 0x80 : 0x00;
+
+			for (i = 0; i < spec->samples; i++) {
+				for (c = 0; c < spec->channels; c++) {
+					long s = (int16_t)(((p[hi] ^ xor) << 8) | p[lo]);
+
+					s = (s * (int)(gain[c] >> 16)) >> 8;
+					p[hi] = (uint8_t)(s >> 8) ^ xor;
+					p[lo] = (uint8_t)s;
+					p += 2;
+					gain[c] += step[c];
+				}
+			}
+			break;
+		}
+
+		case AudioFormatCount:
+			break;
+	}
+
+	VolumeRampEnd();
+}
+
+/******************************************************************************/
+
+/*
+ * Requantization works in half scale (the 16-bit input shifted right by one)
+ * and offset binary so that adding the dither never overflows 16 bits;
+ * the output byte is then simply bits 14-7 of the sum.
+ */
+#define REQUANTIZE_NOISE_SIZE	4096
+
+/* TPDF noise of +-1 LSB of the output, pre-scaled: half scale, +1/2 LSB for rounding, +0x4000 offset */
+static int16_t requantizeNoise[REQUANTIZE_NOISE_SIZE];
+static int requantizeNoiseReady;
+static uint16_t requantizeSeed = 1;
+static int16_t requantizeError[2];	/* half scale */
+
+/* ~0.2 s on a 68000, so done once by the Init functions rather than on the first buffer */
+static void RequantizeBuildNoise(void) {
+	uint32_t seed = 22695477;
+	int i;
+
+	if (requantizeNoiseReady)
+		return;
+
+	for (i = 0; i < REQUANTIZE_NOISE_SIZE; i++) {
+		int r1, r2;
+
+		seed = seed * 1103515245 + 12345;
+		r1 = (int)((seed >> 16) & 0xFF) - 128;
+		seed = seed * 1103515245 + 12345;
+		r2 = (int)((seed >> 16) & 0xFF) - 128;
+
+		/* sum of two rectangular distributions is triangular */
+		requantizeNoise[i] = ((r1 + r2) >> 1) + 64 + 0x4000;
+	}
+
+	requantizeNoiseReady = 1;
+}
+
+static const int16_t* RequantizeNoiseStart(void) {
+	/* cheapest full period 16-bit LCG (multiplier 5 is a shift and an add), once per channel and buffer */
+	requantizeSeed = requantizeSeed * 5 + 0x3619;
+	return requantizeNoise + (requantizeSeed >> 4);
+}
+
+static uint16_t RequantizeClip(uint16_t u) {
+	/* 256-383: over the top, 384-511: wrapped below zero */
+	if (u > 255)
+		u = u < 384 ? 255 : 0;
+
+	return u;
+}
+
+/*
+ * Unverified cycle estimates per sample on a 68000 for the inner loops below,
+ * hand counted for the intended instruction sequences; the actual compiler
+ * output hasn't been checked (no m68k compiler at hand) and may well differ:
+ *
+ *  ~82  dither only (move.w (a0)+ / asr.w #1 / add.w (a2)+ / lsr.w #7 / clip / eor.b / move.b / dbra)
+ * ~180  dither + noise shaping
+ * ~220  dither + software volume (muls.w)
+ * ~320  dither + noise shaping + software volume
+ *
+ * An 8 MHz ST has 160 cycles per sample at 50066 Hz mono or 25033 Hz stereo,
+ * i.e. plain dithering takes about half of the CPU there; 50066 Hz stereo
+ * (80 cycles per sample) is out of reach; this is a known shortfall. With noise shaping or software
+ * volume, 12517 Hz stereo (~45-55%) is the practical limit on a stock ST.
+ */
+void AtariSoundSetupRequantize(const int16_t* src, void* dst, const AudioSpec* spec, int noiseShaping) {
+	const int16_t* const noiseEnd = requantizeNoise + REQUANTIZE_NOISE_SIZE;
+	long gain[2];
+	long step[2];
+	int hasGain;
+	uint8_t xor;
+	int c;
+
+	if (!src || !dst || !spec || spec->samples == 0 || spec->channels == 0 || spec->channels > 2)
+		return;
+
+	if (spec->format != AudioFormatSigned8 && spec->format != AudioFormatUnsigned8)
+		return;
+
+	/* no Init function called yet */
+	if (!requantizeNoiseReady)
+		return;
+
+	/* fused software volume, see AtariSoundSetupSetVolume() */
+	hasGain = VolumeRampBegin(spec, gain, step);
+
+	/* the result is offset binary, i.e. unsigned */
+	xor = spec->format == AudioFormatSigned8 ? 0x80 : 0x00;
+
+	if (!hasGain && !noiseShaping) {
+		/* no per channel state: one pass over the interleaved buffer */
+		const int16_t* noise = RequantizeNoiseStart();
+		uint8_t* d = (uint8_t*)dst;
+		uint16_t remaining = spec->samples * spec->channels;
+
+		while (remaining > 0) {
+			uint16_t count = (uint16_t)(noiseEnd - noise) < remaining ? (uint16_t)(noiseEnd - noise) : remaining;
+
+			remaining -= count;
+			while (count--)
+				*d++ = (uint8_t)RequantizeClip((uint16_t)((*src++ >> 1) + *noise++) >> 7) ^ xor;
+
+			if (noise == noiseEnd)
+				noise = requantizeNoise;
+		}
+
+		return;
+	}
+
+	for (c = 0; c < spec->channels; c++) {
+		const int stride = spec->channels;
+		const int16_t* noise = RequantizeNoiseStart();
+		const int16_t* s = src + c;
+		uint8_t* d = (uint8_t*)dst + c;
+		uint16_t remaining = spec->samples;
+		int16_t e = requantizeError[c];
+		long g = hasGain ? gain[c] : 0;
+		const long gs = hasGain ? step[c] : 0;
+
+		while (remaining > 0) {
+			uint16_t count = (uint16_t)(noiseEnd - noise) < remaining ? (uint16_t)(noiseEnd - noise) : remaining;
+
+			remaining -= count;
+
+			if (!hasGain) {
+				while (count--) {
+					/* first order error feedback pushes the noise towards Nyquist */
+					uint16_t x = (uint16_t)((*s >> 1) - e);
+					uint16_t u = RequantizeClip((uint16_t)(x + *noise++) >> 7);
+
+					e = (int16_t)((u << 7) - x - 0x4000);
+					/* don't let clipping wind up the feedback */
+					if (e > 256)
+						e = 256;
+					else if (e < -256)
+						e = -256;
+
+					*d = (uint8_t)u ^ xor;
+					s += stride;
+					d += stride;
+				}
+			} else if (!noiseShaping) {
+				while (count--) {
+					int16_t h = (int16_t)(((long)*s * (int16_t)(g >> 16)) >> 9);
+
+					*d = (uint8_t)RequantizeClip((uint16_t)(h + *noise++) >> 7) ^ xor;
+					g += gs;
+					s += stride;
+					d += stride;
+				}
+			} else {
+				while (count--) {
+					int16_t h = (int16_t)(((long)*s * (int16_t)(g >> 16)) >> 9);
+					uint16_t x = (uint16_t)(h - e);
+					uint16_t u = RequantizeClip((uint16_t)(x + *noise++) >> 7);
+
+					e = (int16_t)((u << 7) - x - 0x4000);
+					if (e > 256)
+						e = 256;
+					else if (e < -256)
+						e = -256;
+
+					*d = (uint8_t)u ^ xor;
+					g += gs;
+					s += stride;
+					d += stride;
+				}
+			}
+
+			if (noise == noiseEnd)
+				noise = requantizeNoise;
+		}
+
+		requantizeError[c] = e;
+	}
+
+	if (hasGain)
+		VolumeRampEnd();
+}
+
 #endif